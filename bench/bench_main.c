@@ -0,0 +1,338 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <history.h>
+#include <protocol.h>
+#include <spsc_ring.h>
+#include <wire.h>
+
+// Each benchmark is run BENCH_RUNS times; the median and best run are
+// reported so noisy outliers don't dominate a diff between commits
+#define BENCH_RUNS 7
+#define FANOUT_CLIENTS 10
+// Frames per client that fit in a socket buffer without any being dropped
+#define FANOUT_BURST 32
+#define REPLAY_MESSAGES 1000
+
+typedef struct {
+    const char *name;
+    long iterations;
+    // Runs `iterations` operations and returns the elapsed nanoseconds
+    long long (*run)(long iterations);
+} Bench;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Keep the compiler from discarding work whose result is otherwise unused
+static void clobber(void *p) { __asm__ volatile("" : : "g"(p) : "memory"); }
+
+static void make_socketpair(int sv[2]) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        exit(1);
+    }
+}
+
+// Reads and discards everything from a set of fds until all of them hit EOF
+typedef struct {
+    int fds[FANOUT_CLIENTS];
+    int count;
+    atomic_long bytes; // total read so far
+} Drainer;
+
+static void *drain_thread(void *arg) {
+    Drainer *d = arg;
+    struct pollfd pfds[FANOUT_CLIENTS];
+    int open_fds = d->count;
+    char buf[64 * 1024];
+
+    for (int i = 0; i < d->count; i++) {
+        pfds[i].fd = d->fds[i];
+        pfds[i].events = POLLIN;
+    }
+
+    while (open_fds > 0) {
+        if (poll(pfds, d->count, -1) < 0) {
+            break;
+        }
+        for (int i = 0; i < d->count; i++) {
+            if (pfds[i].fd < 0 || !(pfds[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+            ssize_t n = read(pfds[i].fd, buf, sizeof(buf));
+            if (n <= 0) {
+                close(pfds[i].fd);
+                pfds[i].fd = -1;
+                open_fds--;
+            } else {
+                atomic_fetch_add(&d->bytes, n);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Header + body encoding, as done by the client's send_packet
+static long long bench_encode(long iterations) {
+    MessageHeader hdr;
+    MessageBody body;
+
+    long long start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        init_header(&hdr, MSG_CHAT);
+        init_body(&body, "benchmark-user", "hello, this is a chat message");
+        clobber(&hdr);
+        clobber(&body);
+    }
+    return now_ns() - start;
+}
+
+typedef struct {
+    int fd;
+    long frames;
+} Writer;
+
+static void *write_frames_thread(void *arg) {
+    Writer *w = arg;
+    MessageHeader hdr;
+    MessageBody body;
+    init_header(&hdr, MSG_CHAT);
+    init_body(&body, "benchmark-user", "hello, this is a chat message");
+
+    for (long i = 0; i < w->frames; i++) {
+        send_frame(w->fd, &hdr, &body);
+    }
+    return NULL;
+}
+
+// Frame parsing, as done by recv_packet on both client and server
+static long long bench_decode(long iterations) {
+    int sv[2];
+    make_socketpair(sv);
+
+    Writer w = {.fd = sv[0], .frames = iterations};
+    pthread_t writer;
+    pthread_create(&writer, NULL, write_frames_thread, &w);
+
+    MessageHeader hdr;
+    MessageBody body;
+    long long start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        if (recv_frame(sv[1], &hdr, &body) < 0) {
+            fprintf(stderr, "decode: short read at frame %ld\n", i);
+            exit(1);
+        }
+    }
+    long long elapsed = now_ns() - start;
+
+    pthread_join(writer, NULL);
+    close(sv[0]);
+    close(sv[1]);
+    return elapsed;
+}
+
+// broadcast_msg fan-out to FANOUT_CLIENTS connected peers. broadcast_msg
+// drops frames for clients that fall behind, so only bursts that fit in the
+// socket buffers are timed, and the clients catch up between bursts.
+static long long bench_fanout(long iterations) {
+    struct pollfd fds[FANOUT_CLIENTS + 1];
+    Drainer drainer = {.count = FANOUT_CLIENTS};
+
+    fds[0].fd = -1; // slot 0 is the listening socket on the server
+    for (int i = 1; i <= FANOUT_CLIENTS; i++) {
+        int sv[2];
+        make_socketpair(sv);
+        fds[i].fd = sv[0];
+        fds[i].events = POLLIN;
+        drainer.fds[i - 1] = sv[1];
+    }
+
+    pthread_t drain;
+    pthread_create(&drain, NULL, drain_thread, &drainer);
+
+    MessageHeader hdr;
+    MessageBody body;
+    init_header(&hdr, MSG_CHAT);
+    init_body(&body, "benchmark-user", "hello, this is a chat message");
+
+    long long elapsed = 0;
+    long expected = 0;
+    for (long i = 0; i < iterations;) {
+        long burst = iterations - i < FANOUT_BURST ? iterations - i
+                                                   : FANOUT_BURST;
+        long long start = now_ns();
+        for (long j = 0; j < burst; j++) {
+            // Sender is slot 1, so every other client receives the frame
+            broadcast_msg(fds, FANOUT_CLIENTS + 1, 1, &hdr, &body);
+        }
+        elapsed += now_ns() - start;
+        i += burst;
+
+        expected += burst * (FANOUT_CLIENTS - 1) *
+                    (long)(sizeof(MessageHeader) + sizeof(MessageBody));
+        while (atomic_load(&drainer.bytes) < expected) {
+            sched_yield();
+        }
+    }
+
+    for (int i = 1; i <= FANOUT_CLIENTS; i++) {
+        close(fds[i].fd);
+    }
+    pthread_join(drain, NULL);
+    return elapsed;
+}
+
+// history_push from an empty history, including every realloc growth step
+static long long bench_history_push(long iterations) {
+    MessageHistory history;
+    MessageHeaderAndBody msg;
+    init_header(&msg.header, MSG_CHAT);
+    init_body(&msg.body, "benchmark-user", "hello, this is a chat message");
+
+    long long start = now_ns();
+    history_init(&history);
+    for (long i = 0; i < iterations; i++) {
+        history_push(&history, msg);
+    }
+    clobber(history.data);
+    history_free(&history);
+    return now_ns() - start;
+}
+
+// Replaying a stored history to a newly joined user, one frame per message.
+// One iteration is one message sent.
+static long long bench_history_replay(long iterations) {
+    MessageHistory history;
+    history_init(&history);
+    for (int i = 0; i < REPLAY_MESSAGES; i++) {
+        MessageHeaderAndBody msg;
+        init_header(&msg.header, MSG_CHAT);
+        init_body(&msg.body, "benchmark-user", "hello, this is a chat message");
+        history_push(&history, msg);
+    }
+
+    int sv[2];
+    make_socketpair(sv);
+    Drainer drainer = {.fds = {sv[1]}, .count = 1};
+    pthread_t drain;
+    pthread_create(&drain, NULL, drain_thread, &drainer);
+
+    long long start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        MessageHeaderAndBody *msg = &history.data[i % history.length];
+        MessageHeader hdr;
+        MessageBody body;
+        init_header(&hdr, MSG_CHAT);
+        init_body(&body, msg->body.sender_name, msg->body.body);
+        send_frame(sv[0], &hdr, &body);
+    }
+    long long elapsed = now_ns() - start;
+
+    close(sv[0]);
+    pthread_join(drain, NULL);
+    history_free(&history);
+    return elapsed;
+}
+
+typedef struct {
+    SpscRing *ring;
+    long frames;
+} RingProducer;
+
+static void *ring_producer_thread(void *arg) {
+    RingProducer *p = arg;
+    MessageHeaderAndBody msg;
+    init_header(&msg.header, MSG_CHAT);
+    init_body(&msg.body, "benchmark-user", "hello, this is a chat message");
+
+    for (long sent = 0; sent < p->frames;) {
+        if (spsc_ring_push(p->ring, &msg)) {
+            sent++;
+        }
+    }
+    return NULL;
+}
+
+// Handing decoded frames from the client's network thread to the UI thread,
+// drained in UI-sized batches
+static long long bench_spsc_ring(long iterations) {
+    SpscRing ring;
+    spsc_ring_init(&ring, 1024);
+    static MessageHeaderAndBody batch[128];
+
+    RingProducer producer = {.ring = &ring, .frames = iterations};
+    pthread_t thread;
+
+    long long start = now_ns();
+    pthread_create(&thread, NULL, ring_producer_thread, &producer);
+    for (long received = 0; received < iterations;) {
+        received += spsc_ring_pop_batch(&ring, batch, 128);
+    }
+    long long elapsed = now_ns() - start;
+
+    pthread_join(thread, NULL);
+    spsc_ring_free(&ring);
+    return elapsed;
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    // Optional scale factor for quick smoke runs or longer, quieter runs
+    double scale = argc > 1 ? atof(argv[1]) : 1.0;
+    if (scale <= 0) {
+        fprintf(stderr, "usage: %s [scale]\n", argv[0]);
+        return 1;
+    }
+
+    Bench benches[] = {
+        {"encode_frame", 2000000, bench_encode},
+        {"decode_frame", 200000, bench_decode},
+        {"broadcast_fanout_10", 50000, bench_fanout},
+        {"history_push", 1000000, bench_history_push},
+        {"history_replay", 200000, bench_history_replay},
+        {"spsc_ring_transfer", 2000000, bench_spsc_ring},
+    };
+
+    // One JSON object per line so results can be diffed or fed to jq
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        long iterations = (long)(benches[b].iterations * scale);
+        if (iterations < 1) {
+            iterations = 1;
+        }
+
+        long long runs[BENCH_RUNS];
+        for (int r = 0; r < BENCH_RUNS; r++) {
+            runs[r] = benches[b].run(iterations);
+        }
+        qsort(runs, BENCH_RUNS, sizeof(runs[0]), compare_ll);
+
+        double median_ns = (double)runs[BENCH_RUNS / 2] / iterations;
+        double best_ns = (double)runs[0] / iterations;
+        printf("{\"bench\":\"%s\",\"iterations\":%ld,\"runs\":%d,"
+               "\"median_ns_per_op\":%.2f,\"min_ns_per_op\":%.2f,"
+               "\"ops_per_sec\":%.0f}\n",
+               benches[b].name, iterations, BENCH_RUNS, median_ns, best_ns,
+               1e9 / median_ns);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <protocol.h>
+
+void history_init(MessageHistory *h);
+void history_push(MessageHistory *h, MessageHeaderAndBody msg);
+// Insert count messages ahead of everything already in h, e.g. an older page
+void history_prepend(MessageHistory *h, const MessageHeaderAndBody *msgs,
+                     int count);
+void history_free(MessageHistory *h);
@@ -28,6 +28,10 @@ typedef struct {
 
 #pragma pack(pop)
 
+// Header flags
+#define HISTORY_PAGE_END 0x1
+#define HISTORY_PAGE_FAILED 0x2
+
 // Shared enum for message types
 enum MessageType {
     MSG_HELLO = 0,
@@ -37,5 +41,13 @@ enum MessageType {
     MSG_USER_JOINED = 4,
     MSG_USER_DISCONNECTED = 5,
     MSG_ASK_FOR_NAME = 6,
+    // Client -> server: body is the cursor (a message id) to page back from.
+    // Server -> client: one frame per message, oldest first, then a frame
+    // flagged HISTORY_PAGE_END whose body is the next cursor ("" if none).
+    // If HISTORY_PAGE_FAILED is also set the page is incomplete; discard it
+    // and retry with the given cursor.
+    MSG_HISTORY_PAGE = 7,
+    // Server -> client: a request was refused; body says why
+    MSG_ERROR = 8,
     MSG_DISCONNECT = 99
 };
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdbool.h>
+
+// Classic token bucket: holds up to `burst` tokens and refills at `rate`
+// tokens per second. Refilling happens lazily whenever tokens are taken.
+typedef struct {
+    double tokens;
+    double rate;
+    double burst;
+    long long last_ns;
+} TokenBucket;
+
+long long monotonic_ns(void);
+
+// Starts full so a fresh connection isn't throttled on its first messages
+void token_bucket_init(TokenBucket *b, double rate, double burst,
+                       long long now_ns);
+
+// Takes cost tokens if available; returns false (taking nothing) otherwise
+bool token_bucket_take(TokenBucket *b, double cost, long long now_ns);
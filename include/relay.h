@@ -0,0 +1,33 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <protocol.h>
+
+// Server nodes sharing a database relay broadcasts to each other with
+// Postgres LISTEN/NOTIFY on this channel. Payloads are
+//   "<msg_type>\t<message id>\t<sender length>\t<sender>\t<body>"
+// where the id is 0 for events that aren't persisted (joins, leaves). Names
+// are client-controlled and may contain tabs, hence the length prefix.
+#define RELAY_CHANNEL "chat_relay"
+#define RELAY_PAYLOAD_SIZE (sizeof(MessageBody) + 32)
+#define RELAY_SEEN_CAPACITY 512
+
+// Returns 0 on success, -1 if the payload doesn't fit
+int relay_encode(char *out, size_t size, uint8_t type, long long id,
+                 const MessageBody *body);
+
+// Returns 0 on success, -1 on a malformed payload
+int relay_decode(const char *payload, uint8_t *type, long long *id,
+                 MessageBody *body);
+
+// Remembers the last RELAY_SEEN_CAPACITY message ids for duplicate
+// suppression; zero-initialise before use
+typedef struct {
+    long long ids[RELAY_SEEN_CAPACITY];
+    int next;
+} SeenIds;
+
+// Returns true if id was already seen; otherwise records it
+bool seen_ids_check_and_add(SeenIds *seen, long long id);
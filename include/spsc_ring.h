@@ -0,0 +1,31 @@
+#pragma once
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <protocol.h>
+
+// Lock-free single-producer/single-consumer ring of received frames. Exactly
+// one thread may push and exactly one (other) thread may pop.
+typedef struct {
+    MessageHeaderAndBody *slots;
+    size_t mask; // capacity - 1; capacity is a power of two
+    // Producer and consumer indices live on separate cache lines so the two
+    // threads don't invalidate each other on every push/pop
+    alignas(64) atomic_size_t head; // next slot to pop; written by consumer
+    alignas(64) atomic_size_t tail; // next slot to push; written by producer
+} SpscRing;
+
+// capacity is rounded up to a power of two; returns -1 on allocation failure
+int spsc_ring_init(SpscRing *ring, size_t capacity);
+void spsc_ring_free(SpscRing *ring);
+
+// Producer side; returns false if the ring is full
+bool spsc_ring_push(SpscRing *ring, const MessageHeaderAndBody *msg);
+
+// Consumer side; copies up to max frames into out and returns how many
+size_t spsc_ring_pop_batch(SpscRing *ring, MessageHeaderAndBody *out,
+                           size_t max);
+
+bool spsc_ring_empty(SpscRing *ring);
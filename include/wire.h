@@ -0,0 +1,31 @@
+#pragma once
+#include <poll.h>
+#include <stdint.h>
+
+#include <protocol.h>
+
+// Fill in a header for a full MessageBody frame; length is in network order.
+// Callers setting flags must use htons.
+void init_header(MessageHeader *hdr, uint8_t type);
+
+// Copy sender and text into body, truncating to fit
+void init_body(MessageBody *body, const char *sender_name, const char *text);
+
+// Send one header + body frame; returns 0 on success, -1 on error
+int send_frame(int fd, const MessageHeader *hdr, const MessageBody *body);
+
+// Best-effort send that never blocks, for peers that may not be reading.
+// Returns 0 if sent, -1 if dropped because the send buffer is full. A frame
+// that only partly fits would desync the stream, so the connection is shut
+// down instead (the next recv on it fails) and -1 is returned.
+int try_send_frame(int fd, const MessageHeader *hdr, const MessageBody *body);
+
+// Receive one frame; hdr->length and hdr->flags are converted to host order.
+// Returns 0 on success, -1 if the peer hung up or sent a malformed frame
+int recv_frame(int fd, MessageHeader *hdr, MessageBody *body);
+
+// Send a frame to every connected fd in fds[1..nfds-1] except sender_idx,
+// with try_send_frame: a recipient whose send buffer is full misses it.
+// Returns the number of recipients.
+int broadcast_msg(struct pollfd *fds, int nfds, int sender_idx,
+                  MessageHeader *hdr, MessageBody *body);
@@ -1,12 +1,11 @@
-#define _POSIX_C_SOURCE 199309L
+#define _POSIX_C_SOURCE 200809L
 
 #include <arpa/inet.h>
-#include <errno.h>
 #include <fcntl.h>
 #include <ncurses.h>
-#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,7 +13,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <history.h>
 #include <protocol.h>
+#include <spsc_ring.h>
+#include <wire.h>
 
 typedef struct {
     WINDOW *outer;
@@ -28,11 +30,22 @@ BorderedWindow input_win; // fixed bottom line
 #define SERVER_PORT 18000
 #define BUFFER_SIZE 1024
 #define RESIZE_DEBOUNCE_MS 60
+#define INBOX_CAPACITY 1024
+#define UI_BATCH_SIZE 128 // max frames drawn per UI frame
+#define UI_FRAME_MS 16
+#define LINES_PER_MESSAGE 3 // sender, body, blank separator
+#define JOIN_RETRY_MS 1000
 
 long long timespec_to_ns(struct timespec ts) {
     return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
+long long monotonic_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_to_ns(ts);
+}
+
 char current_user_name[64];
 
 BorderedWindow make_bordered_window(int rows, int cols, int y, int x) {
@@ -46,34 +59,15 @@ BorderedWindow make_bordered_window(int rows, int cols, int y, int x) {
     return bw;
 }
 
-void history_init(MessageHistory *h) {
-    h->capacity = 100;
-    h->length = 0;
-    h->data = malloc(h->capacity * sizeof(MessageHeaderAndBody));
-}
-
-void history_push(MessageHistory *h, MessageHeaderAndBody msg) {
-    if (h->length == h->capacity) {
-        h->capacity *= 2;
-        h->data = realloc(h->data, h->capacity * sizeof(MessageHeaderAndBody));
-    }
-    h->data[h->length++] = msg;
-}
-
-void history_free(MessageHistory *h) {
-    free(h->data);
-    h->data = NULL;
-    h->length = h->capacity = 0;
-}
-
 void free_bordered_window(BorderedWindow *bw) {
     delwin(bw->inner);
     delwin(bw->outer);
 }
 
+// Only stages the update; the main loop flushes once per frame with doupdate
 void refresh_bordered_window(BorderedWindow *bw) {
     touchwin(bw->outer);
-    wrefresh(bw->inner);
+    wnoutrefresh(bw->inner);
 }
 
 int get_number_idx_from_name(char *sender_name) {
@@ -118,9 +112,10 @@ void init_ui() {
 
     // make wgetch non-blocking; returns ERR if no input
     nodelay(input_win.inner, TRUE);
+    keypad(input_win.inner, TRUE); // deliver PgUp/PgDn for scrollback
 }
 
-// Call this from your receive thread to post an incoming message
+// Call this from the UI thread to post an incoming message
 void post_message(const char *msg) {
     wprintw(msg_win.inner, "%s\n", msg);
     refresh_bordered_window(&msg_win);
@@ -151,6 +146,29 @@ void format_message_as_alert(char buf[256], char new_buf[256],
 // Global so that the handle_sigint can use it
 int sockfd = -1;
 
+// Frames decoded by the network thread, waiting to be drawn by the UI thread
+SpscRing inbox;
+atomic_bool server_closed = false;
+
+// Runs on its own thread so a long history replay can't stall keystroke
+// handling. Must not touch ncurses; everything is handed to the UI via inbox.
+// Starts with every signal blocked, so signals are left to the UI thread.
+void *recv_thread_main(void *arg) {
+    (void)arg; // unused
+
+    MessageHeaderAndBody msg;
+    while (recv_frame(sockfd, &msg.header, &msg.body) == 0) {
+        // UI is behind; wait for it rather than drop messages. Not reading
+        // from the socket meanwhile lets TCP push back on the server.
+        while (!spsc_ring_push(&inbox, &msg)) {
+            nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+        }
+    }
+
+    atomic_store(&server_closed, true);
+    return NULL;
+}
+
 void send_packet(int sockfd, uint8_t type, const char *body) {
     // current_user_name must be set before sending any messages
     if (current_user_name[0] == '\0') {
@@ -159,16 +177,11 @@ void send_packet(int sockfd, uint8_t type, const char *body) {
     }
 
     MessageHeader hdr;
-    hdr.version = 1;
-    hdr.msg_type = type;
-    hdr.flags = 0;
-    hdr.length = htonl(sizeof(MessageBody)); // convert to network byte order
-    send(sockfd, &hdr, sizeof(hdr), 0);
+    init_header(&hdr, type);
 
     MessageBody msg;
-    strcpy(msg.sender_name, current_user_name);
-    strcpy(msg.body, body);
-    send(sockfd, &msg, sizeof(MessageBody), 0);
+    init_body(&msg, current_user_name, body);
+    send_frame(sockfd, &hdr, &msg);
 }
 
 void handle_sigint(int sig) {
@@ -206,10 +219,16 @@ void log_user_left(MessageBody *message_body) {
                             message_body->sender_name);
 }
 
-void log_successful_connection() {
+void log_error(MessageBody *message_body) {
+    char formatted_error[256];
+    format_message_as_alert(message_body->body, formatted_error, msg_win.inner);
+    post_message_with_flair(formatted_error, message_body->sender_name);
+}
+
+void log_successful_connection(int port) {
     char raw_connection_alert[256];
     snprintf(raw_connection_alert, 256, "Client connected to server at %s:%d\n",
-             SERVER_IP, SERVER_PORT);
+             SERVER_IP, port);
     char formatted_connection_alert[256];
     format_message_as_alert(raw_connection_alert, formatted_connection_alert,
                             msg_win.inner);
@@ -226,7 +245,6 @@ int store_message_in_history(MessageBody *body, MessageHeader *hdr,
     return 0;
 }
 
-// TODO: handle own messages that are received over the wire from history!
 int post_received_message(MessageBody *body, MessageHeader *hdr,
                           MessageHistory *history) {
     // Dim the user's name
@@ -238,27 +256,188 @@ int post_received_message(MessageBody *body, MessageHeader *hdr,
     return 0;
 }
 
-int recv_packet(struct pollfd, MessageBody *message_body,
-                MessageHistory *history) {
-    MessageHeader hdr;
+// Scrollback state. Only the latest page of history arrives on join; older
+// pages are requested as the user scrolls up past what has been loaded.
+MessageHistory incoming_page; // frames of the page currently arriving
+MessageHistory early_messages; // shown once the join page has arrived
+int older_cursor = 0;         // message id to page back from; 0 if none older
+bool page_requested = false;
+bool joined_page_received = false;
+long long join_retry_at = 0; // when to re-request a failed join page, or 0
+int join_retry_cursor = 0;
+int scroll_offset = 0; // history entries hidden below the bottom of the view
+
+int visible_message_count(void) {
+    int count = getmaxy(msg_win.inner) / LINES_PER_MESSAGE;
+    return count > 0 ? count : 1;
+}
+
+// Draws one history entry the same way it was drawn when it first arrived.
+// Messages from current_user_name, including ones loaded from the server's
+// history, are drawn as the user's own.
+void draw_history_entry(MessageHeaderAndBody *entry, MessageHistory *history) {
+    MessageBody *body = &entry->body;
+
+    switch (entry->header.msg_type) {
+    case MSG_USER_JOINED:
+        log_user_joined(body);
+        break;
+    case MSG_USER_DISCONNECTED:
+        log_user_left(body);
+        break;
+    case MSG_ERROR:
+        log_error(body);
+        break;
+    default:
+        if (strcmp(body->sender_name, current_user_name) == 0) {
+            char own[256];
+            format_message_as_own(body->body, own, msg_win.inner);
+            post_message(own);
+        } else {
+            post_received_message(body, &entry->header, history);
+        }
+    }
+    // Post one empty message to force a final newline
+    post_message("");
+}
+
+// Redraw the message window from history, honouring scroll_offset
+void redraw_messages(MessageHistory *history) {
+    werase(msg_win.inner);
+    int end = history->length - scroll_offset;
+    int start = end - visible_message_count();
+    if (start < 0) {
+        start = 0;
+    }
+    for (int i = start; i < end; i++) {
+        draw_history_entry(&history->data[i], history);
+    }
+}
+
+// Ask for the next older page once the view is within a screen of the top of
+// what's loaded, so it usually arrives before the user gets there
+void request_older_page_if_needed(MessageHistory *history) {
+    int top = history->length - scroll_offset - visible_message_count();
+    if (top > visible_message_count() || older_cursor == 0 || page_requested) {
+        return;
+    }
+
+    char cursor[16];
+    snprintf(cursor, sizeof(cursor), "%d", older_cursor);
+    send_packet(sockfd, MSG_HISTORY_PAGE, cursor);
+    page_requested = true;
+}
+
+void retry_join_page_if_due(void) {
+    if (join_retry_at == 0 || monotonic_now_ns() < join_retry_at) {
+        return;
+    }
+
+    char cursor[16];
+    snprintf(cursor, sizeof(cursor), "%d", join_retry_cursor);
+    send_packet(sockfd, MSG_HISTORY_PAGE, cursor);
+    join_retry_at = 0;
+    page_requested = true;
+}
+
+void scroll_messages(MessageHistory *history, int delta) {
+    int max_offset = history->length - visible_message_count();
+    if (max_offset < 0) {
+        max_offset = 0;
+    }
+
+    scroll_offset += delta;
+    if (scroll_offset > max_offset) {
+        scroll_offset = max_offset;
+    }
+    if (scroll_offset < 0) {
+        scroll_offset = 0;
+    }
 
-    // Receive header
-    if (recv(sockfd, &hdr, sizeof(hdr), MSG_WAITALL) <= 0) {
-        // Server disconnected; client should too
-        printf("Server disconnected\n");
-        return -1;
+    redraw_messages(history);
+    request_older_page_if_needed(history);
+}
+
+// Stores a message for the message window and draws it, unless the user has
+// scrolled back
+void append_message(MessageHeaderAndBody *msg, MessageHistory *history) {
+    store_message_in_history(&msg->body, &msg->header, history);
+    if (scroll_offset > 0) {
+        // Keep the scrolled-back view still; it shows up on return
+        scroll_offset++;
+        return;
+    }
+    draw_history_entry(msg, history);
+}
+
+// Like append_message, but anything arriving before the join page is held
+// back until it ends: the page is older, so it must come first both when
+// first drawn and on every redraw
+void show_new_message(MessageHeaderAndBody *msg, MessageHistory *history) {
+    if (!joined_page_received) {
+        history_push(&early_messages, *msg);
+        return;
+    }
+    append_message(msg, history);
+}
+
+void show_early_messages(MessageHistory *history) {
+    for (int i = 0; i < early_messages.length; i++) {
+        append_message(&early_messages.data[i], history);
+    }
+    early_messages.length = 0;
+}
+
+void receive_history_page(MessageHeaderAndBody *msg, MessageHistory *history) {
+    if (!(msg->header.flags & HISTORY_PAGE_END)) {
+        history_push(&incoming_page, *msg);
+        // Join page rows arrive oldest first and belong at the bottom of the
+        // view, so draw each one straight away
+        if (!joined_page_received && scroll_offset == 0) {
+            draw_history_entry(msg, history);
+        }
+        return;
     }
 
-    hdr.length = ntohl(hdr.length); // convert network to local
+    if (msg->header.flags & HISTORY_PAGE_FAILED) {
+        // Incomplete page; the server sent a cursor to retry it with
+        incoming_page.length = 0;
+        if (!joined_page_received) {
+            // Nothing to scroll yet, so retry the join page from here.
+            // Until it arrives chats keep being dropped; the retried page
+            // has them.
+            join_retry_cursor = atoi(msg->body.body);
+            join_retry_at = monotonic_now_ns() + JOIN_RETRY_MS * 1000000LL;
+            page_requested = false;
+            // Clear the rows already drawn from the failed page, then show
+            // what was held back, including the error saying why
+            redraw_messages(history);
+            show_early_messages(history);
+            return;
+        }
+    }
 
-    // Receive real message; use header's length to know how much to read
-    ssize_t n = recv(sockfd, message_body, hdr.length, 0);
-    if (n <= 0) {
-        printf("Error receiving message body\n");
-        return -1;
+    // Older messages go in front; scroll_offset counts from the bottom, so
+    // the current view doesn't move. The join page was drawn as it arrived,
+    // unless a failed attempt left messages below which it now goes above.
+    bool drawn_out_of_order = !joined_page_received && history->length > 0;
+    history_prepend(history, incoming_page.data, incoming_page.length);
+    if (joined_page_received || drawn_out_of_order) {
+        redraw_messages(history);
+    }
+    if (!joined_page_received) {
+        joined_page_received = true;
+        show_early_messages(history);
     }
 
-    message_body->body[n] = '\0';
+    incoming_page.length = 0;
+    older_cursor = atoi(msg->body.body);
+    page_requested = false;
+}
+
+int handle_packet(MessageHeaderAndBody *msg, MessageHistory *history) {
+    MessageHeader hdr = msg->header;
+    MessageBody *message_body = &msg->body;
 
     switch (hdr.msg_type) {
     case MSG_ASK_FOR_NAME: {
@@ -266,18 +445,23 @@ int recv_packet(struct pollfd, MessageBody *message_body,
         post_message(message_body->body);
         break;
     }
-    case MSG_USER_JOINED: {
-        log_user_joined(message_body);
-        break;
-    }
-    case MSG_USER_DISCONNECTED: {
-        log_user_left(message_body);
-        break;
-    }
+    // Everything that shows up in the message window is kept in history so
+    // scrolling and resizing can redraw it
+    case MSG_USER_JOINED:
+    case MSG_USER_DISCONNECTED:
+    case MSG_ERROR:
     case MSG_CHAT: {
-        store_message_in_history(message_body, &hdr, history);
-        post_received_message(message_body, &hdr, history);
-        break;
+        // The server persists a chat before handling the next request, so
+        // any chat reaching us ahead of our join page is also in that page
+        if (hdr.msg_type == MSG_CHAT && !joined_page_received) {
+            return 0;
+        }
+        show_new_message(msg, history);
+        return 0;
+    }
+    case MSG_HISTORY_PAGE: {
+        receive_history_page(msg, history);
+        return 0;
     }
     default:
         printf("Unknown type %d\n", hdr.msg_type);
@@ -306,12 +490,15 @@ static void debounce_resize_event(void) {
         (void)ungetch(next);
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    // Any server node sharing the chat will do; pick one by port
+    int port = argc > 1 ? atoi(argv[1]) : SERVER_PORT;
     struct sockaddr_in server_addr;
-    MessageBody message_body;
     MessageHistory history;
 
     history_init(&history);
+    history_init(&incoming_page);
+    history_init(&early_messages);
 
     init_ui();
 
@@ -326,7 +513,7 @@ int main(void) {
 
     // Configure server address
     server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
+    server_addr.sin_port = htons(port);
     if (inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr) <= 0) {
         perror("inet_pton");
         close(sockfd);
@@ -341,19 +528,54 @@ int main(void) {
         exit(EXIT_FAILURE);
     }
 
-    struct pollfd fds[2];
-    fds[1].fd = sockfd;
-    fds[1].events = POLLIN;
+    if (spsc_ring_init(&inbox, INBOX_CAPACITY) < 0) {
+        perror("spsc_ring_init");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+
+    // The thread inherits this mask. ncurses' SIGWINCH handler doesn't use
+    // SA_RESTART, so a resize landing on the network thread would cut its
+    // recv short and look like the server hanging up.
+    sigset_t all_signals, ui_signals;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &ui_signals);
+    pthread_t net_thread;
+    int thread_err = pthread_create(&net_thread, NULL, recv_thread_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &ui_signals, NULL);
+    if (thread_err != 0) {
+        perror("pthread_create");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
 
     bool has_registered = false;
 
-    log_successful_connection();
+    log_successful_connection(port);
 
     char buf[256];
     int pos = 0;
+    static MessageHeaderAndBody batch[UI_BATCH_SIZE];
 
     // Send message
     while (1) {
+        // Draw a bounded batch of received frames per frame so typing stays
+        // responsive while a large history streams in
+        size_t received = spsc_ring_pop_batch(&inbox, batch, UI_BATCH_SIZE);
+        for (size_t i = 0; i < received; i++) {
+            handle_packet(&batch[i], &history);
+        }
+        if (received == 0 && atomic_load(&server_closed) &&
+            spsc_ring_empty(&inbox)) {
+            // Server disconnected; client should too
+            printf("Server disconnected\n");
+            break;
+        }
+        retry_join_page_if_due();
+        doupdate();
+
+        // Don't wait on the keyboard while there's still a backlog to draw
+        wtimeout(input_win.inner, spsc_ring_empty(&inbox) ? UI_FRAME_MS : 0);
         int ch = wgetch(input_win.inner);
         // Handle input
         if (ch != ERR) {
@@ -371,18 +593,23 @@ int main(void) {
                 input_win = make_bordered_window(3, cols, rows - 3, 0);
                 scrollok(msg_win.inner, TRUE);
                 nodelay(input_win.inner, TRUE);
+                keypad(input_win.inner, TRUE);
 
                 // Redraw the current input buffer
                 mvwprintw(input_win.inner, 0, 0, "%.*s", pos, buf);
 
-                for (int i = 0; i < history.length; i++) {
-                    MessageHeaderAndBody headerAndBody = history.data[i];
-                    post_received_message(&headerAndBody.body,
-                                          &headerAndBody.header, &history);
-
-                    post_message("");
-                }
+                redraw_messages(&history);
                 continue;
+            } else if (ch == KEY_PPAGE || ch == KEY_UP) {
+                if (has_registered) {
+                    scroll_messages(&history, ch == KEY_PPAGE
+                                                  ? visible_message_count()
+                                                  : 1);
+                }
+            } else if (ch == KEY_NPAGE || ch == KEY_DOWN) {
+                scroll_messages(&history, ch == KEY_NPAGE
+                                              ? -visible_message_count()
+                                              : -1);
             } else if (ch == '\n') {
                 if (buf[0] == '\0')
                     continue;
@@ -396,9 +623,22 @@ int main(void) {
                     has_registered = true;
                 }
                 send_packet(sockfd, msg_type, buf);
-                char new_buf[256];
-                format_message_as_own(buf, new_buf, msg_win.inner);
-                post_message(new_buf);
+                if (scroll_offset > 0) {
+                    // Jump back to the bottom so the user sees what they sent
+                    scroll_offset = 0;
+                    redraw_messages(&history);
+                }
+                if (msg_type == MSG_CHAT) {
+                    // Keep our own messages so redraws don't lose them
+                    MessageHeaderAndBody sent;
+                    init_header(&sent.header, MSG_CHAT);
+                    init_body(&sent.body, current_user_name, buf);
+                    show_new_message(&sent, &history);
+                } else {
+                    char new_buf[256];
+                    format_message_as_own(buf, new_buf, msg_win.inner);
+                    post_message(new_buf);
+                }
                 pos = 0;
                 werase(input_win.inner);
                 refresh_bordered_window(&input_win);
@@ -409,32 +649,21 @@ int main(void) {
                     mvwprintw(input_win.inner, 0, 0, "%s", buf);
                     refresh_bordered_window(&input_win);
                 }
-            } else if (pos < 255) {
+            } else if (pos < 255 && ch < KEY_MIN) {
                 buf[pos++] = ch;
                 waddch(input_win.inner, ch);
                 refresh_bordered_window(&input_win);
             }
         }
-
-        int ret = poll(fds, 2, 50); // use 50ms timeout to avoid busy waiting
-        if (ret < 0) {
-            // If window resized while polling, just redraw and continue
-            if (errno == EINTR)
-                continue; // signal interrupted poll (e.g. SIGWINCH); retry
-            perror("poll");
-            break;
-        }
-
-        // Receive message
-        if (fds[1].revents & POLLIN) {
-            if (recv_packet(fds[1], &message_body, &history) < 0) {
-                break;
-            }
-        };
     }
+    shutdown(sockfd, SHUT_RDWR);
+    pthread_join(net_thread, NULL);
     close(sockfd);
+    spsc_ring_free(&inbox);
     free_bordered_window(&input_win);
     free_bordered_window(&msg_win);
     history_free(&history);
+    history_free(&incoming_page);
+    history_free(&early_messages);
     return 0;
 };
@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <history.h>
+
+void history_init(MessageHistory *h) {
+    h->capacity = 100;
+    h->length = 0;
+    h->data = malloc(h->capacity * sizeof(MessageHeaderAndBody));
+}
+
+void history_push(MessageHistory *h, MessageHeaderAndBody msg) {
+    if (h->length == h->capacity) {
+        h->capacity *= 2;
+        h->data = realloc(h->data, h->capacity * sizeof(MessageHeaderAndBody));
+    }
+    h->data[h->length++] = msg;
+}
+
+void history_prepend(MessageHistory *h, const MessageHeaderAndBody *msgs,
+                     int count) {
+    if (count <= 0) {
+        return;
+    }
+    if (h->length + count > h->capacity) {
+        while (h->length + count > h->capacity) {
+            h->capacity *= 2;
+        }
+        h->data = realloc(h->data, h->capacity * sizeof(MessageHeaderAndBody));
+    }
+    memmove(h->data + count, h->data, h->length * sizeof(MessageHeaderAndBody));
+    memcpy(h->data, msgs, count * sizeof(MessageHeaderAndBody));
+    h->length += count;
+}
+
+void history_free(MessageHistory *h) {
+    free(h->data);
+    h->data = NULL;
+    h->length = h->capacity = 0;
+}
@@ -0,0 +1,35 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+
+#include <rate_limit.h>
+
+long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void token_bucket_init(TokenBucket *b, double rate, double burst,
+                       long long now_ns) {
+    b->tokens = burst;
+    b->rate = rate;
+    b->burst = burst;
+    b->last_ns = now_ns;
+}
+
+bool token_bucket_take(TokenBucket *b, double cost, long long now_ns) {
+    if (now_ns > b->last_ns) {
+        b->tokens += (now_ns - b->last_ns) * b->rate / 1e9;
+        if (b->tokens > b->burst) {
+            b->tokens = b->burst;
+        }
+        b->last_ns = now_ns;
+    }
+
+    if (b->tokens < cost) {
+        return false;
+    }
+    b->tokens -= cost;
+    return true;
+}
@@ -0,0 +1,58 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <relay.h>
+
+int relay_encode(char *out, size_t size, uint8_t type, long long id,
+                 const MessageBody *body) {
+    int n = snprintf(out, size, "%u\t%lld\t%zu\t%s\t%s", type, id,
+                     strlen(body->sender_name), body->sender_name, body->body);
+    return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+int relay_decode(const char *payload, uint8_t *type, long long *id,
+                 MessageBody *body) {
+    char *end;
+    long parsed_type = strtol(payload, &end, 10);
+    if (*end != '\t' || parsed_type < 0 || parsed_type > UINT8_MAX) {
+        return -1;
+    }
+    *type = parsed_type;
+
+    *id = strtoll(end + 1, &end, 10);
+    if (*end != '\t') {
+        return -1;
+    }
+
+    long sender_len = strtol(end + 1, &end, 10);
+    if (*end != '\t' || sender_len < 0 ||
+        sender_len >= (long)sizeof(body->sender_name)) {
+        return -1;
+    }
+
+    // The sender is exactly sender_len bytes (tabs included) and must be
+    // followed by the separator; the body is everything after it
+    const char *sender = end + 1;
+    if (strnlen(sender, sender_len) != (size_t)sender_len ||
+        sender[sender_len] != '\t') {
+        return -1;
+    }
+    memcpy(body->sender_name, sender, sender_len);
+    body->sender_name[sender_len] = '\0';
+    snprintf(body->body, sizeof(body->body), "%s", sender + sender_len + 1);
+    return 0;
+}
+
+bool seen_ids_check_and_add(SeenIds *seen, long long id) {
+    for (int i = 0; i < RELAY_SEEN_CAPACITY; i++) {
+        if (seen->ids[i] == id) {
+            return true;
+        }
+    }
+    seen->ids[seen->next] = id;
+    seen->next = (seen->next + 1) % RELAY_SEEN_CAPACITY;
+    return false;
+}
@@ -1,5 +1,6 @@
 #include <arpa/inet.h>
 #include <libpq-fe.h>
+#include <limits.h>
 #include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -9,166 +10,428 @@
 #include <unistd.h>
 
 #include <protocol.h>
+#include <rate_limit.h>
+#include <relay.h>
+#include <wire.h>
 
 #define PORT 18000
 #define MAX_CLIENTS 10
+#define DB_FD_IDX (MAX_CLIENTS + 1) // poll slot for the relay LISTEN socket
 #define BUFFER_SIZE 1024
+#define HISTORY_PAGE_SIZE 50
+#define DB_RETRY_MS 5000 // how often to try reconnecting a lost database
+
+// Per-connection chat limits; bursts up to the given size are allowed
+#define RATE_LIMIT_MSGS_PER_SEC 5
+#define RATE_LIMIT_MSGS_BURST 10
+#define RATE_LIMIT_BYTES_PER_SEC 4096
+#define RATE_LIMIT_BYTES_BURST 8192
+// Frames the server may send per event-loop tick, counting broadcasts and
+// history pages (each tick reads at most one frame per client); clients
+// beyond it are left unread until the next tick
+#define FANOUT_BUDGET_PER_TICK (4 * MAX_CLIENTS)
 
 typedef struct {
     int fd;
     char *name;
+    TokenBucket msg_bucket;
+    TokenBucket byte_bucket;
+    bool throttled; // already told about the current run of rejections
+    // Newest message in the user's join page; relayed chats up to it were
+    // already in that page
+    int join_page_newest_id;
 } User;
 
 void remove_user(int user_idx, User users[MAX_CLIENTS + 1]) {
     memset(&users[user_idx], 0, sizeof(User));
 };
 
-int load_history(PGconn *conn, MessageBody **messages) {
-    PGresult *res = PQexecParams(
-        conn, "SELECT sender, content FROM messages ORDER BY sent_at", 0, NULL,
-        NULL, NULL, NULL, 0);
-
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        fprintf(stderr, "SELECT failed: %s\n", PQerrorMessage(conn));
-        PQclear(res);
-        return 1;
-    }
-
-    int rows = PQntuples(res);
+int send_message_to_user(uint8_t type, char *message, char *sender_name,
+                         struct pollfd fd) {
+    MessageHeader hdr;
+    init_header(&hdr, type);
 
-    MessageBody *results = malloc(rows * sizeof(MessageBody));
+    MessageBody body;
+    init_body(&body, sender_name, message);
 
-    for (int row = 0; row < rows; row++) {
-        strncpy(results[row].sender_name, PQgetvalue(res, row, 0),
-                sizeof(results[row].sender_name) - 1);
-        strncpy(results[row].body, PQgetvalue(res, row, 1),
-                sizeof(results[row].body) - 1);
-        *messages = results;
-    };
-    return rows;
+    return send_frame(fd.fd, &hdr, &body);
 }
 
-int send_message_to_user(char *message, char *sender_name, struct pollfd fd) {
+void send_error_to_user(int fd, const char *reason) {
     MessageHeader hdr;
-    hdr.version = 1;
-    hdr.msg_type = MSG_CHAT;
-    hdr.flags = 0;
-    hdr.length = htonl(sizeof(MessageBody)); // convert to network byte order
+    init_header(&hdr, MSG_ERROR);
 
     MessageBody body;
-    strcpy(body.sender_name, sender_name);
-    strcpy(body.body, message);
+    init_body(&body, "Server", reason);
 
-    send(fd.fd, &hdr, sizeof(hdr), 0);
-    send(fd.fd, &body, sizeof(body), 0);
+    // A flooding client may not be reading; never let it stall the loop
+    try_send_frame(fd, &hdr, &body);
+}
 
-    return 0;
+// Builds the frame that ends a history page; cursor 0 means nothing older.
+// INT_MAX pages back from the newest message, i.e. retries the latest page.
+void init_history_page_end(MessageHeader *hdr, MessageBody *body, int cursor,
+                           bool failed) {
+    char text[16] = "";
+    if (cursor > 0) {
+        snprintf(text, sizeof(text), "%d", cursor);
+    }
+    init_header(hdr, MSG_HISTORY_PAGE);
+    hdr->flags = htons(HISTORY_PAGE_END | (failed ? HISTORY_PAGE_FAILED : 0));
+    init_body(body, "Server", text);
 }
 
-int send_history_to_user(struct pollfd *fds, int sender_idx, PGconn *conn) {
-    MessageBody *messages;
-    int num_messages = load_history(conn, &messages);
+// Streams up to HISTORY_PAGE_SIZE messages older than before_id (0 for the
+// latest page) as MSG_HISTORY_PAGE frames, oldest first, then a
+// HISTORY_PAGE_END frame whose body is the cursor for the next older page.
+// Rows are fetched in single-row mode and each is sent as libpq hands it
+// over, so the page is never built up as one PGresult. Postgres itself still
+// sorts the whole page before returning the first row. If the query fails
+// the user gets a MSG_ERROR and the page is marked failed with a cursor that
+// retries it. Sets *newest_id to the newest message sent (0 if none or the
+// page failed) and returns the number of frames sent.
+int send_history_to_user(struct pollfd *fds, int sender_idx, PGconn *conn,
+                         int before_id, int *newest_id) {
     struct pollfd fd = fds[sender_idx];
+    char before[16];
+    char limit[16];
+    snprintf(before, sizeof(before), "%d", before_id);
+    // Fetch one extra row to learn whether an older page exists
+    snprintf(limit, sizeof(limit), "%d", HISTORY_PAGE_SIZE + 1);
+
+    int rows = 0;
+    int sent = 0;
+    int oldest_id = 0;
+    int newest = 0;
+    bool has_older = false;
+    bool failed = false;
+
+    // The newest rows are picked off the primary key index, then flipped to
+    // oldest first. Both the flip and the window count need every row of the
+    // page, so Postgres buffers it (at most HISTORY_PAGE_SIZE + 1 rows); the
+    // count tells us up front whether the first row is only the lookahead.
+    if (!PQsendQueryParams(conn,
+                           "SELECT id, sender, content, count(*) OVER () "
+                           "FROM (SELECT id, sender, content FROM messages "
+                           "WHERE $1::integer = 0 OR id < $1::integer "
+                           "ORDER BY id DESC LIMIT $2::integer) page "
+                           "ORDER BY id",
+                           2, NULL, (const char *[]){before, limit}, NULL,
+                           NULL, 0) ||
+        !PQsetSingleRowMode(conn)) {
+        fprintf(stderr, "SELECT failed: %s\n", PQerrorMessage(conn));
+        failed = true;
+    }
+
+    // Must read results until NULL even after an error, or the connection
+    // can't be used for the next query
+    PGresult *res;
+    while ((res = PQgetResult(conn)) != NULL) {
+        ExecStatusType status = PQresultStatus(res);
+        if (status == PGRES_SINGLE_TUPLE) {
+            bool lookahead = rows++ == 0 &&
+                             atoi(PQgetvalue(res, 0, 3)) > HISTORY_PAGE_SIZE;
+            if (lookahead) {
+                has_older = true;
+            } else {
+                newest = atoi(PQgetvalue(res, 0, 0));
+                if (sent == 0) {
+                    oldest_id = newest;
+                }
+                send_message_to_user(MSG_HISTORY_PAGE, PQgetvalue(res, 0, 2),
+                                     PQgetvalue(res, 0, 1), fd);
+                sent++;
+            }
+        } else if (status != PGRES_TUPLES_OK) {
+            fprintf(stderr, "SELECT failed: %s\n", PQerrorMessage(conn));
+            failed = true;
+        }
+        PQclear(res);
+    }
 
-    for (int i = 0; i < num_messages; i++) {
-        send_message_to_user(messages[i].body, messages[i].sender_name, fd);
+    int cursor = has_older ? oldest_id : 0;
+    *newest_id = failed ? 0 : newest;
+    if (failed) {
+        // The rows sent so far are the oldest of the page, so the client
+        // drops them and retries the whole page
+        cursor = before_id > 0 ? before_id : INT_MAX;
+        // Clients retry a join page (INT_MAX) by themselves
+        send_error_to_user(fd.fd, cursor == INT_MAX
+                                      ? "Couldn't load message history; "
+                                        "retrying."
+                                      : "Couldn't load message history; "
+                                        "scroll up to retry.");
+        sent++;
     }
 
-    return 0;
+    // Always terminate the page so the client can issue the next request
+    MessageHeader hdr;
+    MessageBody body;
+    init_history_page_end(&hdr, &body, cursor, failed);
+    send_frame(fd.fd, &hdr, &body);
+
+    return sent + 1;
 }
 
-int broadcast_msg(struct pollfd *fds, int sender_idx, MessageHeader *hdr,
-                  MessageBody *body) {
-    for (int i = 1; i <= MAX_CLIENTS; i++) {
-        int fd = fds[i].fd;
+// Returns the new message's id, or -1 on failure
+long long persist_message(char *message, char *author_name, PGconn *conn) {
+    PGresult *res = PQexecParams(
+        conn, "INSERT INTO messages (sender, content) VALUES ($1, $2) "
+              "RETURNING id",
+        2, NULL, (const char *[]){author_name, message}, NULL, NULL, 0);
 
-        if (i == sender_idx || fd < 0) {
-            continue;
-        }
-        send(fd, hdr, sizeof(*hdr), 0);
-        send(fd, body, sizeof(*body), 0);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+        fprintf(stderr, "INSERT failed: %s\n", PQerrorMessage(conn));
+        PQclear(res);
+        return -1;
     }
-    return 0;
-};
 
-int persist_message(char *message, char *author_name, PGconn *conn) {
-    PGresult *res = PQexecParams(
-        conn, "INSERT INTO messages (sender, content) VALUES ($1, $2)", 2, NULL,
-        (const char *[]){author_name, message}, NULL, NULL, 0);
+    long long id = atoll(PQgetvalue(res, 0, 0));
     PQclear(res);
-    return 0;
+    return id;
 };
 
-int recv_packet(int sockfd, struct pollfd fds[MAX_CLIENTS + 1],
-                User users[MAX_CLIENTS + 1], int sender_idx, PGconn *conn) {
-    MessageHeader hdr;
-    if (recv(sockfd, &hdr, sizeof(hdr), MSG_WAITALL) <= 0) {
-        // Tell other users that someone left; clients assume a body is
-        // coming; use an empty one
-        MessageBody message_body;
-        strcpy(message_body.sender_name, users[sender_idx].name);
-        strcpy(message_body.body, "");
+// Relays a frame to peer nodes; id is the message id for persisted chats and
+// 0 for events (join, leave)
+void publish_event(PGconn *conn, uint8_t type, long long id,
+                   MessageBody *body) {
+    char payload[RELAY_PAYLOAD_SIZE];
+    if (relay_encode(payload, sizeof(payload), type, id, body) < 0) {
+        return;
+    }
 
-        MessageHeader hdr;
-        hdr.version = 1;
-        hdr.msg_type = MSG_USER_DISCONNECTED;
-        hdr.flags = 0;
-        hdr.length =
-            htonl(sizeof(MessageBody)); // convert to network byte order
-        broadcast_msg(fds, sender_idx, &hdr, &message_body);
-        close(sockfd);
-        fds[sender_idx].fd = -1;
-        remove_user(sender_idx, users);
-        return 0;
+    PGresult *res =
+        PQexecParams(conn, "SELECT pg_notify('" RELAY_CHANNEL "', $1)", 1,
+                     NULL, (const char *[]){payload}, NULL, NULL, 0);
+    PQclear(res);
+}
+
+// Fans out messages relayed by peer nodes to local users, stopping before a
+// broadcast costing `cost` frames would exceed `budget`. Anything not handled
+// stays queued in libpq and *backlog is set. Returns the number of frames
+// sent.
+int relay_from_peers(PGconn *conn, struct pollfd *fds,
+                     User users[MAX_CLIENTS + 1], SeenIds *seen, int budget,
+                     int cost, bool *backlog) {
+    int sent = 0;
+    PGnotify *notify;
+
+    *backlog = true;
+    while (budget - sent >= cost) {
+        if ((notify = PQnotifies(conn)) == NULL) {
+            *backlog = false;
+            break;
+        }
+
+        uint8_t type;
+        long long id;
+        MessageBody body;
+
+        // Our own notifications come back too, but were already fanned out
+        if (notify->be_pid != PQbackendPID(conn) &&
+            relay_decode(notify->extra, &type, &id, &body) == 0 &&
+            (id == 0 || !seen_ids_check_and_add(seen, id))) {
+            MessageHeader hdr;
+            init_header(&hdr, type);
+            for (int i = 1; i <= MAX_CLIENTS; i++) {
+                // A peer's chat can be committed before a local user's join
+                // page is read but relayed after it; they already have it
+                if (fds[i].fd < 0 ||
+                    (type == MSG_CHAT && id <= users[i].join_page_newest_id)) {
+                    continue;
+                }
+                try_send_frame(fds[i].fd, &hdr, &body);
+                sent++;
+            }
+        }
+        PQfreemem(notify);
     }
+    return sent;
+}
 
-    hdr.length = ntohl(hdr.length); // convert network to local
+// Subscribes to broadcasts from other nodes; returns 0 on success
+int listen_for_relay(PGconn *conn) {
+    PGresult *res = PQexec(conn, "LISTEN " RELAY_CHANNEL);
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) {
+        fprintf(stderr, "LISTEN failed: %s\n", PQerrorMessage(conn));
+    }
+    PQclear(res);
+    return ok ? 0 : -1;
+}
+
+// libpq closes its socket when the database goes away. The old fd must not
+// stay in the poll set: poll would report POLLNVAL on every call, and the
+// number can be reused by a client. Chat keeps working meanwhile; messages
+// just aren't stored or relayed. Reconnects at most every DB_RETRY_MS and
+// returns true while the connection is usable.
+bool check_db_connection(PGconn *conn, struct pollfd *db_fd,
+                         long long *retry_at_ns) {
+    if (PQstatus(conn) == CONNECTION_OK && db_fd->fd >= 0) {
+        return true;
+    }
+    if (db_fd->fd >= 0) {
+        fprintf(stderr, "Lost database connection: %s\n",
+                PQerrorMessage(conn));
+        db_fd->fd = -1;
+        *retry_at_ns = 0; // try once straight away
+    }
 
+    long long now = monotonic_ns();
+    if (now < *retry_at_ns) {
+        return false;
+    }
+    *retry_at_ns = now + DB_RETRY_MS * 1000000LL;
+
+    PQreset(conn);
+    if (PQstatus(conn) != CONNECTION_OK || listen_for_relay(conn) < 0) {
+        return false;
+    }
+    db_fd->fd = PQsocket(conn);
+    fprintf(stderr, "Reconnected to database\n");
+    return true;
+}
+
+// Checks both of the sender's buckets; only charges them if both allow it.
+// Every request that costs the server a broadcast or a query goes through
+// here, not just chat. MSG_DISCONNECT is the exception: it closes the
+// connection, so it can only happen once.
+bool admit_message(User *user, MessageBody *body) {
+    long long now = monotonic_ns();
+    double bytes = strlen(body->body);
+
+    if (!token_bucket_take(&user->msg_bucket, 1, now)) {
+        return false;
+    }
+    if (!token_bucket_take(&user->byte_bucket, bytes, now)) {
+        // Refund the message token so a rejected message costs nothing
+        user->msg_bucket.tokens += 1;
+        return false;
+    }
+    user->throttled = false;
+    return true;
+}
+
+// Tells the user once per run of rejected messages, not once per message
+void reject_message(User *user, const char *reason) {
+    if (!user->throttled) {
+        send_error_to_user(user->fd, reason);
+        user->throttled = true;
+    }
+}
+
+// Tells everyone that a user left, then closes their connection. A
+// connection that never set a name never joined, so nobody is told. Returns
+// the number of frames sent.
+int disconnect_user(int sockfd, struct pollfd fds[MAX_CLIENTS + 1],
+                    User users[MAX_CLIENTS + 1], int sender_idx,
+                    PGconn *conn) {
+    int sent = 0;
+    if (users[sender_idx].name) {
+        // Clients assume a body is coming; use an empty one
+        MessageBody body;
+        init_body(&body, users[sender_idx].name, "");
+
+        MessageHeader hdr;
+        init_header(&hdr, MSG_USER_DISCONNECTED);
+        sent = broadcast_msg(fds, MAX_CLIENTS + 1, sender_idx, &hdr, &body);
+        publish_event(conn, MSG_USER_DISCONNECTED, 0, &body);
+        free(users[sender_idx].name);
+    }
+    close(sockfd);
+    fds[sender_idx].fd = -1;
+    remove_user(sender_idx, users);
+    return sent;
+}
+
+// Returns the number of frames sent, to other users or as history
+int recv_packet(int sockfd, struct pollfd fds[MAX_CLIENTS + 1],
+                User users[MAX_CLIENTS + 1], int sender_idx, PGconn *conn,
+                SeenIds *seen) {
+    MessageHeader hdr;
     MessageBody message_body;
-    if (recv(sockfd, &message_body, hdr.length, MSG_WAITALL) <= 0) {
-        // TODO: free?
-        return 0;
+    if (recv_frame(sockfd, &hdr, &message_body) < 0) {
+        // Either the peer hung up or its frame was short or oversized. The
+        // stream can't be resynced after a bad length, so both end the
+        // connection.
+        return disconnect_user(sockfd, fds, users, sender_idx, conn);
     }
 
+    int sent = 0;
+
     switch (hdr.msg_type) {
     case MSG_SET_NAME: {
+        // Each rename is a broadcast, a NOTIFY and a history page
+        if (!admit_message(&users[sender_idx], &message_body)) {
+            reject_message(&users[sender_idx],
+                           "Slow down! Your name was not changed.");
+            break;
+        }
+
         free(users[sender_idx].name);
         users[sender_idx].name = strdup(message_body.body);
 
         MessageHeader hdr;
-        hdr.version = 1;
-        hdr.msg_type = MSG_USER_JOINED;
-        hdr.flags = 0;
-        hdr.length =
-            htonl(sizeof(MessageBody)); // convert to network byte order
-        broadcast_msg(fds, sender_idx, &hdr, &message_body);
-        send_history_to_user(fds, sender_idx, conn);
+        init_header(&hdr, MSG_USER_JOINED);
+        sent = broadcast_msg(fds, MAX_CLIENTS + 1, sender_idx, &hdr,
+                             &message_body);
+        publish_event(conn, MSG_USER_JOINED, 0, &message_body);
+        // Only the latest page; older ones are fetched as the user scrolls
+        sent += send_history_to_user(fds, sender_idx, conn, 0,
+                                     &users[sender_idx].join_page_newest_id);
+        break;
+    }
+    case MSG_HISTORY_PAGE: {
+        int before_id = atoi(message_body.body);
+        if (before_id <= 0) {
+            break;
+        }
+        if (!admit_message(&users[sender_idx], &message_body)) {
+            // Nothing was loaded; hand the same cursor back as a failed page
+            // so the client retries later instead of taking it as empty
+            MessageHeader hdr;
+            MessageBody body;
+            init_history_page_end(&hdr, &body, before_id, true);
+            try_send_frame(sockfd, &hdr, &body);
+            reject_message(&users[sender_idx],
+                           "Slow down! Older messages were not loaded.");
+            break;
+        }
+        int newest_id;
+        sent += send_history_to_user(fds, sender_idx, conn, before_id,
+                                     &newest_id);
+        // INT_MAX is a join page being retried after it failed
+        if (before_id == INT_MAX) {
+            users[sender_idx].join_page_newest_id = newest_id;
+        }
         break;
     }
     case MSG_CHAT: {
+        if (!admit_message(&users[sender_idx], &message_body)) {
+            reject_message(&users[sender_idx],
+                           "Slow down! Your messages are not being sent.");
+            break;
+        }
+
         MessageHeader hdr;
-        hdr.version = 1;
-        hdr.msg_type = MSG_CHAT;
-        hdr.flags = 0;
-        // TODO: use real length
-        hdr.length =
-            htonl(sizeof(MessageBody)); // convert to network byte order
+        init_header(&hdr, MSG_CHAT);
         // TODO: reuse name
         char *username = strdup(users[sender_idx].name);
-        broadcast_msg(fds, sender_idx, &hdr, &message_body);
+        sent = broadcast_msg(fds, MAX_CLIENTS + 1, sender_idx, &hdr,
+                             &message_body);
         free(username);
-        persist_message(message_body.body, message_body.sender_name, conn);
+        long long id =
+            persist_message(message_body.body, message_body.sender_name, conn);
+        if (id > 0) {
+            seen_ids_check_and_add(seen, id);
+            publish_event(conn, MSG_CHAT, id, &message_body);
+        }
         break;
     }
     case MSG_DISCONNECT: {
-        MessageHeader hdr;
-        hdr.version = 1;
-        hdr.msg_type = MSG_USER_DISCONNECTED;
-        hdr.flags = 0;
-        hdr.length = htonl(sizeof(MessageBody));
-        char *username = strdup(users[sender_idx].name);
-        broadcast_msg(fds, sender_idx, &hdr, &message_body);
-        free(username);
+        // The client is leaving anyway; closing here also means a client
+        // can't send it over and over to flood everyone with leave alerts
+        sent = disconnect_user(sockfd, fds, users, sender_idx, conn);
         break;
     }
     default:
@@ -176,11 +439,15 @@ int recv_packet(int sockfd, struct pollfd fds[MAX_CLIENTS + 1],
     }
 
     // TODO: free?
-    return 0;
+    return sent;
 }
 
-int main(void) {
+int main(int argc, char **argv) {
     User users[MAX_CLIENTS + 1] = {0};
+    SeenIds seen = {0};
+
+    // Several nodes can share one database; give each its own port
+    int port = argc > 1 ? atoi(argv[1]) : PORT;
 
     int listen_fd, new_fd;
     struct sockaddr_in server_addr, client_addr;
@@ -199,7 +466,7 @@ int main(void) {
     // Bind socket
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(PORT);
+    server_addr.sin_port = htons(port);
     if (bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) <
         0) {
         perror("bind");
@@ -223,10 +490,16 @@ int main(void) {
         exit(1);
     }
 
-    printf("Server listening on port %d\n", PORT);
+    // Receive messages relayed by other server nodes
+    if (listen_for_relay(conn) < 0) {
+        PQfinish(conn);
+        exit(1);
+    }
+
+    printf("Server listening on port %d\n", port);
 
     // Prepare poll fds
-    struct pollfd fds[MAX_CLIENTS + 1];
+    struct pollfd fds[MAX_CLIENTS + 2];
     fds[0].fd = listen_fd;
     // Tell poll that we care about events that let us read
     fds[0].events = POLLIN; // Ready to accept connections
@@ -236,9 +509,21 @@ int main(void) {
         fds[i].fd = -1;
     }
 
+    fds[DB_FD_IDX].fd = PQsocket(conn);
+    fds[DB_FD_IDX].events = POLLIN;
+
     // Main loop
+    unsigned int tick = 0;
+    bool relay_backlog = false;
+    long long db_retry_at = 0;
     while (1) {
-        int activity = poll(fds, MAX_CLIENTS + 1, -1);
+        bool db_up = check_db_connection(conn, &fds[DB_FD_IDX], &db_retry_at);
+
+        // Notifications held back by the budget are already buffered in
+        // libpq, so the DB socket won't wake poll for them. While the
+        // database is down, wake up to retry it.
+        int timeout = relay_backlog ? 0 : db_up ? -1 : DB_RETRY_MS;
+        int activity = poll(fds, MAX_CLIENTS + 2, timeout);
         if (activity < 0) {
             perror("poll");
             break;
@@ -256,18 +541,12 @@ int main(void) {
             // Get their name
             char *ask_for_name = "Hi there and welcome. What's your name?\n";
             MessageHeader hdr;
-            hdr.version = 1;
-            hdr.msg_type = MSG_ASK_FOR_NAME;
-            hdr.flags = 0;
-            hdr.length =
-                htonl(sizeof(MessageBody)); // convert to network byte order
+            init_header(&hdr, MSG_ASK_FOR_NAME);
 
             MessageBody body;
-            strcpy(body.sender_name, "Server");
-            strcpy(body.body, ask_for_name);
+            init_body(&body, "Server", ask_for_name);
 
-            send(new_fd, &hdr, sizeof(hdr), 0);
-            send(new_fd, &body, sizeof(body), 0);
+            send_frame(new_fd, &hdr, &body);
 
             // Register user
             for (int i = 1; i <= MAX_CLIENTS; i++) {
@@ -278,14 +557,39 @@ int main(void) {
                     // Track the user
                     users[i].fd = new_fd;
                     users[i].name = NULL;
+                    long long now = monotonic_ns();
+                    token_bucket_init(&users[i].msg_bucket,
+                                      RATE_LIMIT_MSGS_PER_SEC,
+                                      RATE_LIMIT_MSGS_BURST, now);
+                    token_bucket_init(&users[i].byte_bucket,
+                                      RATE_LIMIT_BYTES_PER_SEC,
+                                      RATE_LIMIT_BYTES_BURST, now);
 
                     break;
                 }
             }
         }
 
-        // Handle incoming messages
+        // A single message can fan out to every other connected client
+        int connected = 0;
         for (int i = 1; i <= MAX_CLIENTS; i++) {
+            if (fds[i].fd >= 0)
+                connected++;
+        }
+        int fanout_budget = FANOUT_BUDGET_PER_TICK;
+
+        // Relayed traffic held back last tick goes first, so a busy local
+        // room can't starve it
+        if (relay_backlog) {
+            fanout_budget -=
+                relay_from_peers(conn, fds, users, &seen, fanout_budget,
+                                 connected, &relay_backlog);
+        }
+
+        // Handle incoming messages, starting from a different client each
+        // tick so the ones deferred by the budget aren't always the same
+        for (int n = 0; n < MAX_CLIENTS; n++) {
+            int i = 1 + (tick + n) % MAX_CLIENTS;
             int fd = fds[i].fd;
 
             // If there's no client
@@ -293,9 +597,26 @@ int main(void) {
                 continue;
 
             if (fds[i].revents & POLLIN) {
-                recv_packet(fd, fds, users, i, conn);
+                // Out of budget: leave it in the socket; poll will report
+                // it again straight away on the next tick
+                if (fanout_budget < connected - 1)
+                    break;
+                fanout_budget -= recv_packet(fd, fds, users, i, conn, &seen);
             }
         }
+
+        // Notifications can also arrive while other queries run, so drain
+        // them every tick rather than only when the DB socket is readable.
+        // A hangup also goes through PQconsumeInput, which then marks the
+        // connection bad for check_db_connection.
+        short db_events = POLLIN | POLLHUP | POLLERR | POLLNVAL;
+        if ((fds[DB_FD_IDX].revents & db_events) && !PQconsumeInput(conn)) {
+            fprintf(stderr, "Relay failed: %s\n", PQerrorMessage(conn));
+        }
+        fanout_budget -= relay_from_peers(conn, fds, users, &seen,
+                                          fanout_budget, connected,
+                                          &relay_backlog);
+        tick++;
     }
 
     close(listen_fd);
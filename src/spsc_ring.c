@@ -0,0 +1,60 @@
+#include <stdlib.h>
+
+#include <spsc_ring.h>
+
+int spsc_ring_init(SpscRing *ring, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ring->slots = malloc(size * sizeof(MessageHeaderAndBody));
+    if (ring->slots == NULL) {
+        return -1;
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+void spsc_ring_free(SpscRing *ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+    ring->mask = 0;
+}
+
+bool spsc_ring_push(SpscRing *ring, const MessageHeaderAndBody *msg) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head > ring->mask) {
+        return false;
+    }
+
+    ring->slots[tail & ring->mask] = *msg;
+    // Publish the slot contents before the new tail becomes visible
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+size_t spsc_ring_pop_batch(SpscRing *ring, MessageHeaderAndBody *out,
+                           size_t max) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    size_t count = tail - head;
+    if (count > max) {
+        count = max;
+    }
+    for (size_t i = 0; i < count; i++) {
+        out[i] = ring->slots[(head + i) & ring->mask];
+    }
+    // Hand the slots back to the producer only after they've been copied out
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    return count;
+}
+
+bool spsc_ring_empty(SpscRing *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) ==
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
@@ -0,0 +1,79 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+#include <wire.h>
+
+void init_header(MessageHeader *hdr, uint8_t type) {
+    hdr->version = 1;
+    hdr->msg_type = type;
+    hdr->flags = 0;
+    hdr->length = htonl(sizeof(MessageBody)); // convert to network byte order
+}
+
+void init_body(MessageBody *body, const char *sender_name, const char *text) {
+    snprintf(body->sender_name, sizeof(body->sender_name), "%s", sender_name);
+    snprintf(body->body, sizeof(body->body), "%s", text);
+}
+
+// MSG_NOSIGNAL: a peer that hung up should show up as a failed send, not
+// kill the whole process with SIGPIPE
+int send_frame(int fd, const MessageHeader *hdr, const MessageBody *body) {
+    if (send(fd, hdr, sizeof(*hdr), MSG_NOSIGNAL) != sizeof(*hdr)) {
+        return -1;
+    }
+    if (send(fd, body, sizeof(*body), MSG_NOSIGNAL) != sizeof(*body)) {
+        return -1;
+    }
+    return 0;
+}
+
+int try_send_frame(int fd, const MessageHeader *hdr, const MessageBody *body) {
+    // One buffer, so the frame either goes out whole or (mostly) not at all
+    MessageHeaderAndBody frame = {.header = *hdr, .body = *body};
+    ssize_t n = send(fd, &frame, sizeof(frame), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n == sizeof(frame)) {
+        return 0;
+    }
+    if (n > 0) {
+        shutdown(fd, SHUT_RDWR);
+    }
+    return -1;
+}
+
+int recv_frame(int fd, MessageHeader *hdr, MessageBody *body) {
+    if (recv(fd, hdr, sizeof(*hdr), MSG_WAITALL) != sizeof(*hdr)) {
+        return -1;
+    }
+
+    hdr->length = ntohl(hdr->length); // convert network to local
+    hdr->flags = ntohs(hdr->flags);
+    if (hdr->length == 0 || hdr->length > sizeof(*body)) {
+        return -1;
+    }
+
+    if (recv(fd, body, hdr->length, MSG_WAITALL) != (ssize_t)hdr->length) {
+        return -1;
+    }
+
+    // Peers always send NUL-terminated strings, but don't trust them to
+    body->sender_name[sizeof(body->sender_name) - 1] = '\0';
+    body->body[sizeof(body->body) - 1] = '\0';
+    return 0;
+}
+
+int broadcast_msg(struct pollfd *fds, int nfds, int sender_idx,
+                  MessageHeader *hdr, MessageBody *body) {
+    int sent = 0;
+    for (int i = 1; i < nfds; i++) {
+        int fd = fds[i].fd;
+
+        if (i == sender_idx || fd < 0) {
+            continue;
+        }
+        // One client that stops reading must not stall everyone else
+        try_send_frame(fd, hdr, body);
+        sent++;
+    }
+    return sent;
+}
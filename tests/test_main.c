@@ -0,0 +1,17 @@
+#include <unity.h>
+
+// Each tests/test_*.c file registers its cases in one run_*_tests function
+void run_rate_limit_tests(void);
+void run_relay_tests(void);
+void run_spsc_ring_tests(void);
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(void) {
+    UNITY_BEGIN();
+    run_rate_limit_tests();
+    run_relay_tests();
+    run_spsc_ring_tests();
+    return UNITY_END();
+}
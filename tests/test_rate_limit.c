@@ -0,0 +1,52 @@
+#include <rate_limit.h>
+#include <unity.h>
+
+#define SECOND_NS 1000000000LL
+
+void test_bucket_refills_over_time(void) {
+    TokenBucket b;
+    token_bucket_init(&b, 2, 4, 0);
+
+    TEST_ASSERT_TRUE(token_bucket_take(&b, 4, 0));
+    TEST_ASSERT_FALSE(token_bucket_take(&b, 1, 0));
+
+    // Half a second at 2 tokens/s buys exactly one token
+    TEST_ASSERT_TRUE(token_bucket_take(&b, 1, SECOND_NS / 2));
+    TEST_ASSERT_FALSE(token_bucket_take(&b, 1, SECOND_NS / 2));
+}
+
+void test_bucket_refill_is_capped_at_burst(void) {
+    TokenBucket b;
+    token_bucket_init(&b, 10, 3, 0);
+    TEST_ASSERT_TRUE(token_bucket_take(&b, 3, 0));
+
+    // A long idle stretch refills to burst, not rate * elapsed
+    TEST_ASSERT_TRUE(token_bucket_take(&b, 3, 100 * SECOND_NS));
+    TEST_ASSERT_FALSE(token_bucket_take(&b, 1, 100 * SECOND_NS));
+}
+
+void test_bucket_rejects_cost_above_tokens_without_charging(void) {
+    TokenBucket b;
+    token_bucket_init(&b, 1, 5, 0);
+    TEST_ASSERT_TRUE(token_bucket_take(&b, 3, 0));
+
+    TEST_ASSERT_FALSE(token_bucket_take(&b, 3, 0));
+    TEST_ASSERT_TRUE(b.tokens == 2);
+    TEST_ASSERT_TRUE(token_bucket_take(&b, 2, 0));
+}
+
+void test_bucket_ignores_clock_going_backwards(void) {
+    TokenBucket b;
+    token_bucket_init(&b, 1, 1, SECOND_NS);
+    TEST_ASSERT_TRUE(token_bucket_take(&b, 1, SECOND_NS));
+
+    TEST_ASSERT_FALSE(token_bucket_take(&b, 1, 0));
+    TEST_ASSERT_TRUE(b.last_ns == SECOND_NS);
+}
+
+void run_rate_limit_tests(void) {
+    RUN_TEST(test_bucket_refills_over_time);
+    RUN_TEST(test_bucket_refill_is_capped_at_burst);
+    RUN_TEST(test_bucket_rejects_cost_above_tokens_without_charging);
+    RUN_TEST(test_bucket_ignores_clock_going_backwards);
+}
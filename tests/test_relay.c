@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include <relay.h>
+#include <unity.h>
+#include <wire.h>
+
+static void assert_round_trip(uint8_t type, long long id, const char *sender,
+                              const char *text) {
+    MessageBody in;
+    init_body(&in, sender, text);
+
+    char payload[RELAY_PAYLOAD_SIZE];
+    TEST_ASSERT_EQUAL_INT(
+        0, relay_encode(payload, sizeof(payload), type, id, &in));
+
+    uint8_t out_type;
+    long long out_id;
+    MessageBody out;
+    TEST_ASSERT_EQUAL_INT(0, relay_decode(payload, &out_type, &out_id, &out));
+    TEST_ASSERT_EQUAL_UINT8(type, out_type);
+    TEST_ASSERT_TRUE(out_id == id);
+    TEST_ASSERT_EQUAL_STRING(sender, out.sender_name);
+    TEST_ASSERT_EQUAL_STRING(text, out.body);
+}
+
+void test_round_trip_plain_message(void) {
+    assert_round_trip(MSG_CHAT, 42, "alice", "hello");
+}
+
+void test_round_trip_tabs_in_sender_and_body(void) {
+    assert_round_trip(MSG_CHAT, 7, "al\tice", "hel\tlo\t");
+}
+
+void test_round_trip_event_without_id(void) {
+    assert_round_trip(MSG_USER_JOINED, 0, "bob", "");
+}
+
+void test_decode_rejects_sender_longer_than_payload(void) {
+    uint8_t type;
+    long long id;
+    MessageBody body;
+    TEST_ASSERT_EQUAL_INT(-1, relay_decode("2\t1\t10\tbob\thi", &type, &id,
+                                           &body));
+}
+
+void test_seen_ids_suppresses_duplicates(void) {
+    SeenIds seen = {0};
+    TEST_ASSERT_FALSE(seen_ids_check_and_add(&seen, 5));
+    TEST_ASSERT_TRUE(seen_ids_check_and_add(&seen, 5));
+    TEST_ASSERT_FALSE(seen_ids_check_and_add(&seen, 6));
+}
+
+void run_relay_tests(void) {
+    RUN_TEST(test_round_trip_plain_message);
+    RUN_TEST(test_round_trip_tabs_in_sender_and_body);
+    RUN_TEST(test_round_trip_event_without_id);
+    RUN_TEST(test_decode_rejects_sender_longer_than_payload);
+    RUN_TEST(test_seen_ids_suppresses_duplicates);
+}
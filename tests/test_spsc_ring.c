@@ -0,0 +1,149 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <spsc_ring.h>
+#include <unity.h>
+#include <wire.h>
+
+#define THREADED_FRAMES 100000
+
+static MessageHeaderAndBody numbered(int n) {
+    MessageHeaderAndBody msg;
+    char text[16];
+    snprintf(text, sizeof(text), "%d", n);
+    init_header(&msg.header, MSG_CHAT);
+    init_body(&msg.body, "tester", text);
+    return msg;
+}
+
+static int number_of(const MessageHeaderAndBody *msg) {
+    return atoi(msg->body.body);
+}
+
+void test_ring_pops_nothing_when_empty(void) {
+    SpscRing ring;
+    MessageHeaderAndBody out[4];
+    TEST_ASSERT_EQUAL_INT(0, spsc_ring_init(&ring, 4));
+
+    TEST_ASSERT_TRUE(spsc_ring_empty(&ring));
+    TEST_ASSERT_EQUAL_INT(0, spsc_ring_pop_batch(&ring, out, 4));
+    spsc_ring_free(&ring);
+}
+
+void test_ring_rejects_push_when_full(void) {
+    SpscRing ring;
+    MessageHeaderAndBody out[8];
+    // Rounded up to 8
+    TEST_ASSERT_EQUAL_INT(0, spsc_ring_init(&ring, 5));
+
+    for (int i = 0; i < 8; i++) {
+        MessageHeaderAndBody msg = numbered(i);
+        TEST_ASSERT_TRUE(spsc_ring_push(&ring, &msg));
+    }
+    MessageHeaderAndBody extra = numbered(8);
+    TEST_ASSERT_FALSE(spsc_ring_push(&ring, &extra));
+
+    // Freeing one slot makes room for exactly one more
+    TEST_ASSERT_EQUAL_INT(1, spsc_ring_pop_batch(&ring, out, 1));
+    TEST_ASSERT_EQUAL_INT(0, number_of(&out[0]));
+    TEST_ASSERT_TRUE(spsc_ring_push(&ring, &extra));
+    TEST_ASSERT_FALSE(spsc_ring_push(&ring, &extra));
+
+    TEST_ASSERT_EQUAL_INT(8, spsc_ring_pop_batch(&ring, out, 8));
+    for (int i = 0; i < 8; i++) {
+        TEST_ASSERT_EQUAL_INT(i + 1, number_of(&out[i]));
+    }
+    TEST_ASSERT_TRUE(spsc_ring_empty(&ring));
+    spsc_ring_free(&ring);
+}
+
+void test_ring_pop_batch_stops_at_max(void) {
+    SpscRing ring;
+    MessageHeaderAndBody out[8];
+    TEST_ASSERT_EQUAL_INT(0, spsc_ring_init(&ring, 8));
+
+    for (int i = 0; i < 5; i++) {
+        MessageHeaderAndBody msg = numbered(i);
+        TEST_ASSERT_TRUE(spsc_ring_push(&ring, &msg));
+    }
+
+    TEST_ASSERT_EQUAL_INT(2, spsc_ring_pop_batch(&ring, out, 2));
+    TEST_ASSERT_EQUAL_INT(0, number_of(&out[0]));
+    TEST_ASSERT_EQUAL_INT(1, number_of(&out[1]));
+    TEST_ASSERT_FALSE(spsc_ring_empty(&ring));
+
+    TEST_ASSERT_EQUAL_INT(3, spsc_ring_pop_batch(&ring, out, 8));
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_INT(i + 2, number_of(&out[i]));
+    }
+    TEST_ASSERT_TRUE(spsc_ring_empty(&ring));
+    spsc_ring_free(&ring);
+}
+
+void test_ring_keeps_order_across_wraparound(void) {
+    SpscRing ring;
+    MessageHeaderAndBody out[4];
+    TEST_ASSERT_EQUAL_INT(0, spsc_ring_init(&ring, 4));
+
+    // 3 in, 3 out never lines up with the 4 slots, so every slot gets used
+    // at every offset
+    int next_in = 0;
+    int next_out = 0;
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 3; i++) {
+            MessageHeaderAndBody msg = numbered(next_in++);
+            TEST_ASSERT_TRUE(spsc_ring_push(&ring, &msg));
+        }
+        TEST_ASSERT_EQUAL_INT(3, spsc_ring_pop_batch(&ring, out, 4));
+        for (int i = 0; i < 3; i++) {
+            TEST_ASSERT_EQUAL_INT(next_out++, number_of(&out[i]));
+        }
+    }
+    spsc_ring_free(&ring);
+}
+
+static void *produce_numbered(void *arg) {
+    SpscRing *ring = arg;
+    for (int i = 0; i < THREADED_FRAMES;) {
+        MessageHeaderAndBody msg = numbered(i);
+        if (spsc_ring_push(ring, &msg)) {
+            i++;
+        }
+    }
+    return NULL;
+}
+
+void test_ring_transfers_between_threads_in_order(void) {
+    SpscRing ring;
+    MessageHeaderAndBody out[3];
+    // Small ring and batches so both full and empty are hit over and over
+    TEST_ASSERT_EQUAL_INT(0, spsc_ring_init(&ring, 16));
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, produce_numbered, &ring);
+
+    int expected = 0;
+    bool in_order = true;
+    while (expected < THREADED_FRAMES) {
+        size_t count = spsc_ring_pop_batch(&ring, out, 3);
+        for (size_t i = 0; i < count; i++) {
+            in_order = in_order && number_of(&out[i]) == expected;
+            expected++;
+        }
+    }
+    pthread_join(producer, NULL);
+
+    TEST_ASSERT_TRUE(in_order);
+    TEST_ASSERT_EQUAL_INT(THREADED_FRAMES, expected);
+    TEST_ASSERT_TRUE(spsc_ring_empty(&ring));
+    spsc_ring_free(&ring);
+}
+
+void run_spsc_ring_tests(void) {
+    RUN_TEST(test_ring_pops_nothing_when_empty);
+    RUN_TEST(test_ring_rejects_push_when_full);
+    RUN_TEST(test_ring_pop_batch_stops_at_max);
+    RUN_TEST(test_ring_keeps_order_across_wraparound);
+    RUN_TEST(test_ring_transfers_between_threads_in_order);
+}